@@ -0,0 +1,100 @@
+/** @file 04-gestures
+ *  @author Alessandro Saccoia <alessandro@alsc.co>
+ *
+ *  Shows the gesture recognition: double tap, range, chord and row swipe
+ */
+
+#include "MonomeGrid.h"
+#include <iostream>
+#include <memory>
+#include <cstdlib>
+#include <algorithm>
+
+void usage();
+
+// free-standing C callbacks: could have used a lambda or a function
+void buttonPushed(int x, int y, MonomeGrid::ButtonState state);
+void gridRefreshed();
+void gestureRecognized(const MonomeGrid::GestureEvent& gesture);
+
+using namespace std;
+
+unique_ptr<MonomeGrid> monome;
+
+int main (int argc, char **argv) {
+  if (argc != 4) {
+     usage();
+  }
+  
+  const char* monomeName = argv[1];
+  int width = atoi(argv[2]);
+  int height = atoi(argv[3]);
+  
+  monome.reset(new MonomeGrid(monomeName, width, height, buttonPushed, gridRefreshed));
+  
+  // all the gestures are enabled by default, here we just make chords easier
+  MonomeGrid::GestureConfig config;
+  config.chordWindow = std::chrono::milliseconds(80);
+  monome->setGestureCallback(gestureRecognized, config);
+  
+  cout << endl << "Double tap: blink a button" << endl
+    << "Hold a button and press another on the same row or column: light the range" << endl
+    << "Press three buttons together: clear the grid" << endl
+    << "Swipe along a row: blink the row" << endl;
+  
+  // resets all leds to off
+  monome->setAllLeds(MonomeGrid::LED_OFF);
+  
+  // enters the infinite loop
+  monome->loop();
+}
+
+// free-standing C callback: could have used a lambda or a function
+void buttonPushed(int, int, MonomeGrid::ButtonState) {
+  // do nothing, everything happens in gestureRecognized
+}
+
+// free-standing C callback: could have used a lambda or a function
+void gridRefreshed() {
+ // do nothing
+}
+
+// free-standing C callback: could have used a lambda or a function
+void gestureRecognized(const MonomeGrid::GestureEvent& gesture) {
+  switch (gesture.type) {
+    case MonomeGrid::GESTURE_DOUBLE_TAP:
+      cout << "double tap " << gesture.keys[0].x << " " << gesture.keys[0].y << endl;
+      monome->setOneLed(gesture.keys[0].x, gesture.keys[0].y, MonomeGrid::LED_BLINK_FAST);
+      break;
+    case MonomeGrid::GESTURE_RANGE: {
+      cout << "range " << gesture.keys[0].x << " " << gesture.keys[0].y
+        << " - " << gesture.keys[1].x << " " << gesture.keys[1].y << endl;
+      // the two keys share either the row or the column
+      int x0 = min(gesture.keys[0].x, gesture.keys[1].x);
+      int x1 = max(gesture.keys[0].x, gesture.keys[1].x);
+      int y0 = min(gesture.keys[0].y, gesture.keys[1].y);
+      int y1 = max(gesture.keys[0].y, gesture.keys[1].y);
+      for (int x = x0; x <= x1; ++x)
+        for (int y = y0; y <= y1; ++y)
+          monome->setOneLed(x, y, MonomeGrid::LED_ON);
+      break;
+    }
+    case MonomeGrid::GESTURE_CHORD:
+      cout << "chord of " << gesture.numKeys << " buttons" << endl;
+      monome->setAllLeds(MonomeGrid::LED_OFF);
+      break;
+    case MonomeGrid::GESTURE_SWIPE:
+      cout << "swipe on row " << gesture.keys[0].y << endl;
+      monome->setRow(gesture.keys[0].y, MonomeGrid::LED_BLINK_SLOW);
+      break;
+  }
+}
+
+void usage() {
+  std::cout << "Usage:" << std::endl
+     << "04-gestures monomeName width height" << std::endl
+     << "monomeName = /dev/tty.usbserial-m40h0351" << std::endl
+     << "height = 8 for a 40h" << std::endl
+     << "width = 8 for a 40h" << std::endl;
+  exit(1);
+}
@@ -10,6 +10,11 @@
 #include <stdio.h>
 #include <monome.h>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <chrono>
+#include <functional>
 #include "TPCircularBuffer.h"
 
 /*!
@@ -41,6 +46,14 @@
   - a MxN input matrix of push buttons (you decide what to do when they are pushed)
   - a MxN input matrix of LEDs (you decide when to light them up)
  
+  On top of the raw touches, an optional GestureCallback can be installed with
+  setGestureCallback(). Gestures (double tap, range, chord, row swipe) are
+  recognized incrementally as the buttons are pressed, so each touch only costs
+  a walk over the keys currently held. Gestures that end with a timeout (chords
+  and swipes) are delivered by the refresh thread, like TOUCH_LONG. A gesture
+  that could still be part of another one (a range inside a chord window or a
+  swipe, a swipe inside a chord window) is held back until that is decided.
+ 
 */
 
 class MonomeGrid {
@@ -62,6 +75,54 @@ class MonomeGrid {
    *    - change the state of the LEDs
    */
   typedef std::function<void(void)> GridRefreshed;
+  
+  /// Kind of gesture reported by the GestureCallback
+  enum GestureType {
+    GESTURE_DOUBLE_TAP, // the same button pressed twice within doubleTapTime
+    GESTURE_RANGE,      // a button pressed while another one on the same row or column is held,
+                        // not reported when the same keys make a chord or a swipe
+    GESTURE_CHORD,      // chordMinKeys or more buttons pressed within chordWindow, and still held
+    GESTURE_SWIPE       // adjacent buttons of a row pressed one after the other,
+                        // not reported when the same keys make a chord
+  };
+  
+  /// Maximum number of buttons reported by a single GestureEvent
+  static const int kMaxGestureKeys = 16;
+  
+  /** A recognized gesture.
+   *  - GESTURE_DOUBLE_TAP: keys[0] is the button tapped
+   *  - GESTURE_RANGE: keys[0] is the held button, keys[1] the one just pressed
+   *  - GESTURE_CHORD: keys[] are the buttons held, in the order they were pressed
+   *  - GESTURE_SWIPE: keys[] are the buttons swiped, from the first to the last
+   */
+  struct GestureEvent {
+    GestureType type;
+    int numKeys;
+    struct {
+      int x;
+      int y;
+    } keys[kMaxGestureKeys];
+  };
+  
+  /// Type of callback called when a gesture is recognized
+  typedef std::function<void(const GestureEvent&)> GestureCallback;
+  
+  /// Which gestures to recognize, and their timings
+  struct GestureConfig {
+    GestureConfig()
+      : doubleTap(true), range(true), chord(true), swipe(true)
+      , doubleTapTime(300), chordWindow(60), swipeStepTime(150)
+      , chordMinKeys(3), swipeMinKeys(3) {}
+    bool doubleTap;
+    bool range;
+    bool chord;
+    bool swipe;
+    std::chrono::milliseconds doubleTapTime; // max time between the two presses
+    std::chrono::milliseconds chordWindow;   // time after the first press to collect the chord
+    std::chrono::milliseconds swipeStepTime; // max time between two adjacent presses
+    int chordMinKeys; // 2 to kMaxGestureKeys, clamped by setGestureCallback
+    int swipeMinKeys; // 2 to kMaxGestureKeys, clamped by setGestureCallback
+  };
  
   /** Constructor
    *  @param monomeName The name used to open the monome connection
@@ -107,6 +168,16 @@ class MonomeGrid {
   /// Sets one column to the given state
   void setColumn(int x, LedState state);
   
+  /** Enables the gesture recognition
+   *  @param gestureCb_ Called when a gesture is recognized
+   *  @param config The gestures to recognize and their timings
+   *
+   *  @note gestureCb_ is called either on the thread calling loop() or, for
+   *  the gestures ending with a timeout, on the internal thread. The calls
+   *  never overlap and follow the order in which the gestures were recognized
+   */
+  void setGestureCallback(GestureCallback gestureCb_, const GestureConfig& config = GestureConfig());
+  
 private:
  
   friend void handle_press(const monome_event_t *e, void *data);
@@ -136,6 +207,53 @@ private:
   
   typedef std::chrono::system_clock::time_point monome_time_t;
   
+  void gestureTouched(int x, int y, bool isDown, monome_time_t now); // called by buttonTouched
+  void checkGestureDeadlines();                                      // called by updateGrid
+  bool isHeld(int x, int y) const;
+  void closeChord(GestureEvent* events, int& numEvents); // appends the chord, if any
+  void closeSwipe(GestureEvent* events, int& numEvents); // appends the swipe, if any
+  void resolvePendingRanges(bool chordClosed, bool isChord
+    , bool swipeClosed, bool isSwipe, GestureEvent* events, int& numEvents);
+  void deliverGestures(const GestureCallback& cb, const GestureEvent* events
+    , int numEvents, unsigned long ticket);
+  
+  // gestures waiting for a chord window or a swipe to close: beyond this
+  // number they are delivered straight away
+  static const int kMaxPendingGestures = 4;
+  // deferred swipes, chord, swipe, pending ranges, range and double tap
+  static const int kMaxGestureBatch = 2 * kMaxPendingGestures + 4;
+  
+  // gesture recognizer state, guarded by mGestureMutex
+  std::mutex mGestureMutex;
+  GestureCallback mGestureCb;
+  GestureConfig mGestureConfig;
+  std::vector<std::pair<int, int> > mHeldKeys; // in press order, reserved to mWidth*mHeight
+  struct {
+    int x;
+    int y;
+    monome_time_t time;
+    bool valid;
+  } mLastTap;
+  GestureEvent mChord; // keys pressed since the chord window opened, numKeys == 0 if none
+  monome_time_t mChordDeadline;
+  GestureEvent mSwipe; // the swipe being tracked, numKeys == 0 if none
+  int mSwipeDirection; // +1 or -1 along x, 0 if only one key so far
+  monome_time_t mSwipeDeadline;
+  struct PendingRange {
+    GestureEvent event;
+    bool waitsChord;
+    bool waitsSwipe;
+  } mPendingRanges[kMaxPendingGestures];
+  int mNumPendingRanges;
+  GestureEvent mDeferredSwipes[kMaxPendingGestures]; // ended inside the chord window
+  int mNumDeferredSwipes;
+  unsigned long mNextDelivery; // next ticket, taken under mGestureMutex
+  
+  // callback calls are serialized in ticket order
+  std::mutex mDeliveryMutex;
+  std::condition_variable mDeliveryTurn;
+  unsigned long mDelivered; // ticket being delivered
+  
   typedef struct MonomeCell {
     MonomeCell() : ledState(LED_OFF), lastLedState(LED_OFF), buttonState(TOUCH_UP) {}
     int ledState;
@@ -7,6 +7,7 @@
 #include "MonomeGrid.h"
 
 #include <cmath>
+#include <algorithm>
 
 #define LONG_PRESS_TIME 0.5F
 #define BLACK_MAGIC 135246
@@ -43,7 +44,12 @@ MonomeGrid::MonomeGrid(
   : mWidth(width_)
   , mHeight(height_)
   , mButtonsCb(cb_)
-  , mRefreshCb(refreshCb_) {
+  , mRefreshCb(refreshCb_)
+  , mSwipeDirection(0)
+  , mNumPendingRanges(0)
+  , mNumDeferredSwipes(0)
+  , mNextDelivery(0)
+  , mDelivered(0) {
   
   if( !(mMonome = monome_open(monomeName_)) )
 		throw std::runtime_error("Impossible to open monome");
@@ -62,6 +68,13 @@ MonomeGrid::MonomeGrid(
   blinkingSpeeds[1].bits = 0x8;
   blinkingSpeeds[1].log2Bits = log2(blinkingSpeeds[1].bits);
   
+  mHeldKeys.reserve(mWidth*mHeight);
+  mLastTap.valid = false;
+  mChord.type = GESTURE_CHORD;
+  mChord.numKeys = 0;
+  mSwipe.type = GESTURE_SWIPE;
+  mSwipe.numKeys = 0;
+  
 	monome_register_handler(mMonome, MONOME_BUTTON_DOWN, handle_press, this);
 	monome_register_handler(mMonome, MONOME_BUTTON_UP, handle_press, this);
   
@@ -156,6 +169,9 @@ void MonomeGrid::updateGrid() {
           }
         }
       }
+    
+    // delivers the gestures whose time window expired
+    checkGestureDeadlines();
       
     // Executes the commands
     int numReadBytes;
@@ -265,10 +281,314 @@ void MonomeGrid::setColumn(int x, LedState state) {
   TPCircularBufferProduceBytes(&mCommandsBuffer, &cmd, sizeof(MonomeCommand));
 }
 
+void MonomeGrid::setGestureCallback(GestureCallback gestureCb_, const GestureConfig& config) {
+  std::lock_guard<std::mutex> lock(mGestureMutex);
+  mGestureCb = gestureCb_;
+  mGestureConfig = config;
+  // a single key is not a gesture, and a GestureEvent can't report more than kMaxGestureKeys
+  mGestureConfig.chordMinKeys = std::min(std::max(mGestureConfig.chordMinKeys, 2), (int)kMaxGestureKeys);
+  mGestureConfig.swipeMinKeys = std::min(std::max(mGestureConfig.swipeMinKeys, 2), (int)kMaxGestureKeys);
+  mHeldKeys.clear();
+  mLastTap.valid = false;
+  mChord.numKeys = 0;
+  mSwipe.numKeys = 0;
+  mSwipeDirection = 0;
+  mNumPendingRanges = 0;
+  mNumDeferredSwipes = 0;
+}
+
 void MonomeGrid::buttonTouched(int x, int y, bool isDown) {
+  monome_time_t now = std::chrono::system_clock::now();
   if (isDown) {
-    mGrid[x][y].buttonDownTime = std::chrono::system_clock::now();
+    mGrid[x][y].buttonDownTime = now;
   }
   mGrid[x][y].buttonState = isDown ? TOUCH_DOWN : TOUCH_UP;
   mButtonsCb(x,y,mGrid[x][y].buttonState);
+  gestureTouched(x, y, isDown, now);
+}
+
+static bool gestureHasKey(const MonomeGrid::GestureEvent& e, int x, int y) {
+  for (int i = 0; i < e.numKeys; ++i) {
+    if (e.keys[i].x == x && e.keys[i].y == y) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool gesturesOverlap(const MonomeGrid::GestureEvent& a, const MonomeGrid::GestureEvent& b) {
+  for (int i = 0; i < a.numKeys; ++i) {
+    if (gestureHasKey(b, a.keys[i].x, a.keys[i].y)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool MonomeGrid::isHeld(int x, int y) const {
+  for (size_t i = 0; i < mHeldKeys.size(); ++i) {
+    if (mHeldKeys[i].first == x && mHeldKeys[i].second == y) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Every touch updates the recognizer state in O(held keys): nothing here scans
+// the grid. The events are queued under the state lock and the callbacks are
+// called once it has been released, so that they can safely call
+// setGestureCallback or any of the setXXX methods.
+void MonomeGrid::gestureTouched(int x, int y, bool isDown, monome_time_t now) {
+  GestureEvent events[kMaxGestureBatch];
+  int numEvents = 0;
+  GestureCallback cb;
+  unsigned long ticket;
+  {
+    std::lock_guard<std::mutex> lock(mGestureMutex);
+    if (!mGestureCb) {
+      return;
+    }
+    
+    if (!isDown) {
+      for (size_t i = 0; i < mHeldKeys.size(); ++i) {
+        if (mHeldKeys[i].first == x && mHeldKeys[i].second == y) {
+          mHeldKeys.erase(mHeldKeys.begin() + i); // keeps the press order
+          break;
+        }
+      }
+      return;
+    }
+    
+    // first the gestures that this press closes, because they happened before it
+    
+    // chord: a window that expired before updateGrid could close it
+    if (mChord.numKeys > 0 && now >= mChordDeadline) {
+      closeChord(events, numEvents);
+    }
+    
+    // swipe: extend the current run if the button is next to the last one,
+    // in the same direction, otherwise close it and start a new run from here
+    bool extendsSwipe = false;
+    if (mGestureConfig.swipe) {
+      if (mSwipe.numKeys > 0 && now <= mSwipeDeadline) {
+        const int lastX = mSwipe.keys[mSwipe.numKeys - 1].x;
+        const int lastY = mSwipe.keys[mSwipe.numKeys - 1].y;
+        const int dx = x - lastX;
+        extendsSwipe = (y == lastY) && (dx == 1 || dx == -1)
+          && (mSwipeDirection == 0 || mSwipeDirection == dx);
+        if (extendsSwipe) {
+          mSwipeDirection = dx;
+        }
+      }
+      if (!extendsSwipe) {
+        closeSwipe(events, numEvents);
+      }
+    }
+    
+    // then the gestures that this press starts or completes
+    
+    // range: the oldest held button on the same row or column is the anchor.
+    // Inside a chord window or a swipe it waits for them to close, and it is
+    // dropped if they turn out to be a chord or a swipe
+    if (mGestureConfig.range) {
+      for (size_t i = 0; i < mHeldKeys.size(); ++i) {
+        if (mHeldKeys[i].first == x || mHeldKeys[i].second == y) {
+          const bool waitsChord = mGestureConfig.chord && mChord.numKeys > 0;
+          const bool waitsSwipe = extendsSwipe;
+          GestureEvent* e = &events[numEvents];
+          if ((waitsChord || waitsSwipe) && mNumPendingRanges < kMaxPendingGestures) {
+            PendingRange& pending = mPendingRanges[mNumPendingRanges++];
+            pending.waitsChord = waitsChord;
+            pending.waitsSwipe = waitsSwipe;
+            e = &pending.event;
+          } else {
+            ++numEvents;
+          }
+          e->type = GESTURE_RANGE;
+          e->numKeys = 2;
+          e->keys[0].x = mHeldKeys[i].first;
+          e->keys[0].y = mHeldKeys[i].second;
+          e->keys[1].x = x;
+          e->keys[1].y = y;
+          break;
+        }
+      }
+    }
+    
+    // double tap: a third tap starts a new pair
+    if (mGestureConfig.doubleTap) {
+      if (mLastTap.valid && mLastTap.x == x && mLastTap.y == y
+          && now - mLastTap.time <= mGestureConfig.doubleTapTime) {
+        GestureEvent& e = events[numEvents++];
+        e.type = GESTURE_DOUBLE_TAP;
+        e.numKeys = 1;
+        e.keys[0].x = x;
+        e.keys[0].y = y;
+        mLastTap.valid = false;
+      } else {
+        mLastTap.x = x;
+        mLastTap.y = y;
+        mLastTap.time = now;
+        mLastTap.valid = true;
+      }
+    }
+    
+    // chord: the first press after a window opens a new one, whatever is held,
+    // and updateGrid closes it. A key pressed twice in the window counts once
+    if (mGestureConfig.chord) {
+      if (mChord.numKeys == 0) {
+        mChordDeadline = now + mGestureConfig.chordWindow;
+      }
+      if (mChord.numKeys < kMaxGestureKeys && !gestureHasKey(mChord, x, y)) {
+        mChord.keys[mChord.numKeys].x = x;
+        mChord.keys[mChord.numKeys].y = y;
+        ++mChord.numKeys;
+      }
+    }
+    
+    if (mGestureConfig.swipe) {
+      // once full, the last slot keeps tracking the end of the swipe
+      int slot = mSwipe.numKeys < kMaxGestureKeys ? mSwipe.numKeys++ : kMaxGestureKeys - 1;
+      mSwipe.keys[slot].x = x;
+      mSwipe.keys[slot].y = y;
+      mSwipeDeadline = now + mGestureConfig.swipeStepTime;
+    }
+    
+    mHeldKeys.push_back(std::make_pair(x, y));
+    
+    if (numEvents == 0) {
+      return;
+    }
+    cb = mGestureCb;
+    ticket = mNextDelivery++;
+  }
+  deliverGestures(cb, events, numEvents, ticket);
+}
+
+void MonomeGrid::closeChord(GestureEvent* events, int& numEvents) {
+  // only the keys of the window that are still held make the chord
+  GestureEvent chord;
+  chord.type = GESTURE_CHORD;
+  chord.numKeys = 0;
+  for (int i = 0; i < mChord.numKeys; ++i) {
+    if (isHeld(mChord.keys[i].x, mChord.keys[i].y)) {
+      chord.keys[chord.numKeys++] = mChord.keys[i];
+    }
+  }
+  const bool isChord = chord.numKeys >= mGestureConfig.chordMinKeys;
+  mChord.numKeys = 0;
+  
+  // the swipes that ended inside the window, unless they were the chord
+  for (int i = 0; i < mNumDeferredSwipes; ++i) {
+    if (!isChord || !gesturesOverlap(mDeferredSwipes[i], chord)) {
+      events[numEvents++] = mDeferredSwipes[i];
+    }
+  }
+  mNumDeferredSwipes = 0;
+  
+  if (isChord) {
+    // keys held together are a chord, even if they are adjacent
+    mSwipe.numKeys = 0;
+    mSwipeDirection = 0;
+  }
+  resolvePendingRanges(true, isChord, isChord, isChord, events, numEvents);
+  
+  if (isChord) {
+    events[numEvents++] = chord;
+  }
+}
+
+void MonomeGrid::closeSwipe(GestureEvent* events, int& numEvents) {
+  const bool isSwipe = mSwipe.numKeys >= mGestureConfig.swipeMinKeys;
+  if (isSwipe) {
+    // while a chord window is open the same keys could still be a chord
+    if (mChord.numKeys > 0 && gesturesOverlap(mSwipe, mChord)
+        && mNumDeferredSwipes < kMaxPendingGestures) {
+      mDeferredSwipes[mNumDeferredSwipes++] = mSwipe;
+    } else {
+      events[numEvents++] = mSwipe;
+    }
+  }
+  mSwipe.numKeys = 0;
+  mSwipeDirection = 0;
+  resolvePendingRanges(false, false, true, isSwipe, events, numEvents);
+}
+
+// Called when the chord window and/or the swipe the pending ranges wait for
+// are closed: a range is dropped if what it waited for was recognized,
+// delivered once it doesn't wait for anything anymore.
+void MonomeGrid::resolvePendingRanges(bool chordClosed, bool isChord
+  , bool swipeClosed, bool isSwipe, GestureEvent* events, int& numEvents) {
+  int kept = 0;
+  for (int i = 0; i < mNumPendingRanges; ++i) {
+    PendingRange& pending = mPendingRanges[i];
+    if ((chordClosed && pending.waitsChord && isChord)
+        || (swipeClosed && pending.waitsSwipe && isSwipe)) {
+      continue;
+    }
+    if (chordClosed) {
+      pending.waitsChord = false;
+    }
+    if (swipeClosed) {
+      pending.waitsSwipe = false;
+    }
+    if (!pending.waitsChord && !pending.waitsSwipe) {
+      events[numEvents++] = pending.event;
+    } else {
+      mPendingRanges[kept++] = pending;
+    }
+  }
+  mNumPendingRanges = kept;
+}
+
+void MonomeGrid::checkGestureDeadlines() {
+  GestureEvent events[kMaxGestureBatch];
+  int numEvents = 0;
+  GestureCallback cb;
+  unsigned long ticket;
+  {
+    std::lock_guard<std::mutex> lock(mGestureMutex);
+    if (!mGestureCb) {
+      return;
+    }
+    
+    const monome_time_t now = std::chrono::system_clock::now();
+    const bool chordExpired = mChord.numKeys > 0 && now >= mChordDeadline;
+    const bool swipeExpired = mSwipe.numKeys > 0 && now > mSwipeDeadline;
+    
+    // in the order the two windows expired
+    if (chordExpired && swipeExpired && mSwipeDeadline < mChordDeadline) {
+      closeSwipe(events, numEvents);
+      closeChord(events, numEvents);
+    } else {
+      if (chordExpired) {
+        closeChord(events, numEvents);
+      }
+      if (swipeExpired) {
+        closeSwipe(events, numEvents);
+      }
+    }
+    
+    if (numEvents == 0) {
+      return;
+    }
+    cb = mGestureCb;
+    ticket = mNextDelivery++;
+  }
+  deliverGestures(cb, events, numEvents, ticket);
+}
+
+// The two threads take a ticket under mGestureMutex and deliver in ticket
+// order, one at a time, so the callback calls never overlap nor reorder.
+void MonomeGrid::deliverGestures(const GestureCallback& cb, const GestureEvent* events
+  , int numEvents, unsigned long ticket) {
+  std::unique_lock<std::mutex> lock(mDeliveryMutex);
+  mDeliveryTurn.wait(lock, [&] { return mDelivered == ticket; });
+  lock.unlock();
+  for (int i = 0; i < numEvents; ++i) {
+    cb(events[i]);
+  }
+  lock.lock();
+  ++mDelivered;
+  mDeliveryTurn.notify_all();
 }